@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "star.h"
+
+// Codigo compartido entre star y star-mount, y funciones para leer un tar desde otros programas
+
+long parse_memory_size(const char *text) {
+    // Acepta bytes o un sufijo K, M o G (por ejemplo 64M), devuelve -1 si no es valido
+    char *suffix;
+    errno = 0;
+    long size = strtol(text, &suffix, 10);
+    if (suffix == text || size <= 0 || errno == ERANGE) return -1;
+
+    long multiplier = 1;
+    if (*suffix == 'K' || *suffix == 'k') multiplier = 1024L;
+    else if (*suffix == 'M' || *suffix == 'm') multiplier = 1024L * 1024;
+    else if (*suffix == 'G' || *suffix == 'g') multiplier = 1024L * 1024 * 1024;
+    if (multiplier != 1) suffix++;
+
+    if (*suffix != '\0' || size > LONG_MAX / multiplier) return -1;
+    return size * multiplier;
+}
+
+int replay_log(int fd, FAT *fat) {
+    // Agrega a la FAT del ultimo checkpoint las entradas de los registros del log, del mas viejo al mas nuevo
+    long positions[LOG_CHECKPOINT_RECORDS];
+    long records_num = 0;
+    for (long position = fat->log_last; position != 0 && records_num < LOG_CHECKPOINT_RECORDS; records_num++) {
+        LogRecord record;
+        if (pread(fd, &record, sizeof(LogRecord), position) != sizeof(LogRecord) || record.magic != LOG_MAGIC) return -1;
+        positions[records_num] = position;
+        position = record.prev;
+    }
+
+    for (long i = records_num - 1; i >= 0; i--) {
+        LogRecord record;
+        pread(fd, &record, sizeof(LogRecord), positions[i]);
+        if (fat->files_num + record.entries_num > MAX_FILES) return -1;
+        long size = record.entries_num * sizeof(FileEntry);
+        if (pread(fd, &fat->files[fat->files_num], size, positions[i] + sizeof(LogRecord)) != size) return -1;
+        fat->files_num += record.entries_num;
+    }
+    return 0;
+}
+
+int lock_fd_range(int fd, short type, long start, long len) {
+    // Espera el bloqueo reintentando si una señal interrumpe la espera, devuelve -1 ante cualquier otro error
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = start;
+    lock.l_len = len;
+    int result;
+    do {
+        result = fcntl(fd, F_OFD_SETLKW, &lock);
+    } while (result == -1 && errno == EINTR);
+    return result;
+}
+
+int load_fat_snapshot(int fd, FAT *fat) {
+    // Lee la FAT y fija su generacion mientras fd siga abierto, el escritor no reutiliza sus bloques
+    if (lock_fd_range(fd, F_RDLCK, LOCK_HEADER_OFFSET, 1) == -1) return -1;
+    ssize_t bytes_read = pread(fd, fat, sizeof(FAT), 0);
+    int result = -1;
+    if (bytes_read == sizeof(FAT) && fat->magic == STAR_MAGIC && fat->version == STAR_VERSION) {
+        result = replay_log(fd, fat);
+    }
+    if (result == 0) {
+        result = lock_fd_range(fd, F_RDLCK, LOCK_READERS_OFFSET + fat->generation, 1);
+    }
+    lock_fd_range(fd, F_UNLCK, LOCK_HEADER_OFFSET, 1);
+    return result;
+}
+
+long contiguous_blocks(FileEntry *entry, long j, long max_blocks) {
+    // Cantidad de bloques seguidos en el tar a partir del bloque j
+    long run = 1;
+    while (run < max_blocks && j + run < entry->blocks_num
+           && entry->block_positions[j + run] != HOLE_BLOCK
+           && entry->block_positions[j + run] == entry->block_positions[j + run - 1] + BLOCK_SIZE) {
+        run++;
+    }
+    return run;
+}
+
+long read_file_from_tar(const char *tar_filename, const char *filename, void *buffer, long buffer_size) {
+    // Copia el contenido del archivo directamente en buffer, sin archivos intermedios.
+    // Devuelve la cantidad de bytes copiados (a lo sumo buffer_size) o -1 si no se encuentra o hay un error
+    int tar_fd = open(tar_filename, O_RDONLY);
+    if (tar_fd == -1) return -1;
+
+    FAT *fat = malloc(sizeof(FAT));
+    if (fat == NULL || load_fat_snapshot(tar_fd, fat) == -1) {
+        free(fat);
+        close(tar_fd);
+        return -1;
+    }
+
+    long copied = -1;
+    for (long i = 0; i < fat->files_num && copied == -1; i++) {
+        FileEntry *file_entry = &fat->files[i];
+        if (strcmp(file_entry->filename, filename) != 0) continue;
+
+        long to_copy = file_entry->file_size < buffer_size ? file_entry->file_size : buffer_size;
+        copied = 0;
+        for (long j = 0; j < file_entry->blocks_num && copied < to_copy; ) {
+            long run = 1;
+            if (file_entry->block_positions[j] != HOLE_BLOCK) run = contiguous_blocks(file_entry, j, file_entry->blocks_num);
+
+            long len = (copied + run * sizeof(Block) > to_copy) ? to_copy - copied : run * sizeof(Block);
+            if (file_entry->block_positions[j] == HOLE_BLOCK) {
+                memset((char *) buffer + copied, 0, len);
+            } else if (pread(tar_fd, (char *) buffer + copied, len, file_entry->block_positions[j]) != len) {
+                copied = -1;
+                break;
+            }
+
+            copied += len;
+            j += run;
+        }
+    }
+
+    free(fat);
+    close(tar_fd);
+    return copied;
+}
+
+//Para usar desde otro programa: incluir star.h y compilar junto con star-lib.c
+//long bytes = read_file_from_tar("prueba-paq.tar", "prueba.txt", buffer, sizeof(buffer));
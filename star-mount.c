@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION 31
+#include <fuse.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "star.h"
+
+#define READAHEAD_BLOCKS 4 // Bloques que se piden por adelantado en lecturas secuenciales
+
+typedef struct {
+    long position; // Posicion del bloque en el tar, HOLE_BLOCK si la entrada esta vacia
+    long hash_next; // Siguiente entrada con el mismo hash, -1 al final
+    long lru_prev; // Vecinos en la lista LRU, la entrada usada mas recientemente va primero
+    long lru_next;
+    int users; // Lecturas que estan cargando o copiando el bloque, mientras tanto no se reemplaza
+    bool loading; // El pread del bloque se hace fuera del mutex
+    Block *block;
+} CacheEntry;
+
+typedef struct {
+    long entry_index;
+    long last_block; // Ultimo bloque leido, para detectar acceso secuencial
+} OpenFile;
+
+int tar_fd = -1;
+FAT *fat = NULL;
+
+typedef struct {
+    char *max_memory;
+} MountOptions;
+
+// La cache LRU ocupa lo que queda de -o max_memory despues de la FAT, indexada por posicion con un hash.
+// El mutex solo protege la estructura, las lecturas del tar y las copias se hacen sin tenerlo
+CacheEntry *cache = NULL;
+long cache_blocks = 0;
+long *cache_buckets = NULL;
+long cache_buckets_mask = 0;
+long lru_first = -1;
+long lru_last = -1;
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cache_changed = PTHREAD_COND_INITIALIZER;
+
+long find_entry(const char *path) {
+    for (long i = 0; i < fat->files_num; i++) {
+        if (strcmp(fat->files[i].filename, path + 1) == 0) return i;
+    }
+    return -1;
+}
+
+bool is_directory(const char *path) {
+    // Los directorios no se guardan en la FAT, existen si algun archivo esta dentro de ellos
+    if (strcmp(path, "/") == 0) return true;
+    size_t len = strlen(path + 1);
+    for (long i = 0; i < fat->files_num; i++) {
+        const char *filename = fat->files[i].filename;
+        if (strncmp(filename, path + 1, len) == 0 && filename[len] == '/') return true;
+    }
+    return false;
+}
+
+long *cache_bucket(long position) {
+    // Los bloques no se solapan, asi que position / BLOCK_SIZE es distinto para cada uno
+    return &cache_buckets[(position / BLOCK_SIZE) & cache_buckets_mask];
+}
+
+void cache_unhash(long index) {
+    if (cache[index].position == HOLE_BLOCK) return;
+    long *link = cache_bucket(cache[index].position);
+    while (*link != index) link = &cache[*link].hash_next;
+    *link = cache[index].hash_next;
+    cache[index].position = HOLE_BLOCK;
+}
+
+void lru_remove(long index) {
+    if (cache[index].lru_prev != -1) cache[cache[index].lru_prev].lru_next = cache[index].lru_next;
+    else lru_first = cache[index].lru_next;
+    if (cache[index].lru_next != -1) cache[cache[index].lru_next].lru_prev = cache[index].lru_prev;
+    else lru_last = cache[index].lru_prev;
+}
+
+void lru_push_front(long index) {
+    cache[index].lru_prev = -1;
+    cache[index].lru_next = lru_first;
+    if (lru_first != -1) cache[lru_first].lru_prev = index;
+    else lru_last = index;
+    lru_first = index;
+}
+
+void put_block(long index) {
+    pthread_mutex_lock(&cache_mutex);
+    if (--cache[index].users == 0) pthread_cond_broadcast(&cache_changed);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+long get_block(long position) {
+    // Devuelve la entrada de la cache con el bloque, reservada hasta llamar a put_block, o -1 si hay un error.
+    // Si no esta se reemplaza la menos usada recientemente que nadie este usando
+    pthread_mutex_lock(&cache_mutex);
+    long index = *cache_bucket(position);
+    while (index != -1 && cache[index].position != position) index = cache[index].hash_next;
+
+    if (index != -1) {
+        cache[index].users++;
+        lru_remove(index);
+        lru_push_front(index);
+        // Otro hilo lo esta leyendo del tar, esperar a que termine
+        while (cache[index].loading) pthread_cond_wait(&cache_changed, &cache_mutex);
+        bool loaded = cache[index].position == position;
+        pthread_mutex_unlock(&cache_mutex);
+        if (!loaded) {
+            put_block(index);
+            return -1;
+        }
+        return index;
+    }
+
+    while (true) {
+        index = lru_last;
+        while (index != -1 && cache[index].users > 0) index = cache[index].lru_prev;
+        if (index != -1) break;
+        pthread_cond_wait(&cache_changed, &cache_mutex);
+    }
+
+    cache_unhash(index);
+    long *bucket = cache_bucket(position);
+    cache[index].position = position;
+    cache[index].hash_next = *bucket;
+    *bucket = index;
+    cache[index].users = 1;
+    cache[index].loading = true;
+    lru_remove(index);
+    lru_push_front(index);
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (cache[index].block == NULL) cache[index].block = malloc(sizeof(Block));
+    bool loaded = cache[index].block != NULL
+                  && pread(tar_fd, cache[index].block, sizeof(Block), position) == sizeof(Block);
+
+    pthread_mutex_lock(&cache_mutex);
+    cache[index].loading = false;
+    if (!loaded) cache_unhash(index);
+    pthread_cond_broadcast(&cache_changed);
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (!loaded) {
+        put_block(index);
+        return -1;
+    }
+    return index;
+}
+
+void readahead_blocks(FileEntry *entry, long next_block) {
+    // Pedir al kernel los siguientes bloques sin esperar a que se lean
+    for (long j = next_block; j < next_block + READAHEAD_BLOCKS && j < entry->blocks_num; j++) {
+        if (entry->block_positions[j] == HOLE_BLOCK) continue;
+        posix_fadvise(tar_fd, entry->block_positions[j], sizeof(Block), POSIX_FADV_WILLNEED);
+    }
+}
+
+int star_getattr(const char *path, struct stat *st, struct fuse_file_info *fi) {
+    memset(st, 0, sizeof(struct stat));
+
+    long index = find_entry(path);
+    if (index != -1) {
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+        st->st_size = fat->files[index].file_size;
+        st->st_blocks = 0;
+        for (long j = 0; j < fat->files[index].blocks_num; j++) {
+            if (fat->files[index].block_positions[j] != HOLE_BLOCK) st->st_blocks += BLOCK_SIZE / 512;
+        }
+        return 0;
+    }
+
+    if (is_directory(path)) {
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+int star_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+    if (!is_directory(path)) return -ENOENT;
+
+    filler(buf, ".", NULL, 0, 0);
+    filler(buf, "..", NULL, 0, 0);
+
+    const char *prefix = path + 1;
+    size_t prefix_len = strlen(prefix);
+    for (long i = 0; i < fat->files_num; i++) {
+        const char *filename = fat->files[i].filename;
+        if (prefix_len > 0) {
+            if (strncmp(filename, prefix, prefix_len) != 0 || filename[prefix_len] != '/') continue;
+            filename += prefix_len + 1;
+        }
+
+        // Mostrar solo el primer componente, un subdirectorio puede aparecer en varias entradas
+        char name[MAX_FILENAME_LENGTH];
+        strncpy(name, filename, MAX_FILENAME_LENGTH - 1);
+        name[MAX_FILENAME_LENGTH - 1] = '\0';
+        char *slash = strchr(name, '/');
+        if (slash != NULL) *slash = '\0';
+
+        bool repeated = false;
+        for (long k = 0; k < i && slash != NULL; k++) {
+            const char *other = fat->files[k].filename;
+            if (prefix_len > 0) {
+                if (strncmp(other, prefix, prefix_len) != 0 || other[prefix_len] != '/') continue;
+                other += prefix_len + 1;
+            }
+            if (strncmp(other, name, strlen(name)) == 0 && other[strlen(name)] == '/') repeated = true;
+        }
+        if (!repeated) filler(buf, name, NULL, 0, 0);
+    }
+
+    return 0;
+}
+
+int star_open(const char *path, struct fuse_file_info *fi) {
+    long index = find_entry(path);
+    if (index == -1) return -ENOENT;
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) return -EROFS;
+
+    OpenFile *open_file = malloc(sizeof(OpenFile));
+    if (open_file == NULL) return -ENOMEM;
+    open_file->entry_index = index;
+    open_file->last_block = -1;
+    fi->fh = (uint64_t) open_file;
+    return 0;
+}
+
+int star_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    OpenFile *open_file = (OpenFile *) fi->fh;
+    FileEntry *entry = &fat->files[open_file->entry_index];
+
+    if (offset >= entry->file_size) return 0;
+    if (offset + size > entry->file_size) size = entry->file_size - offset;
+
+    size_t copied = 0;
+    while (copied < size) {
+        long j = (offset + copied) / BLOCK_SIZE;
+        long block_offset = (offset + copied) % BLOCK_SIZE;
+        size_t len = BLOCK_SIZE - block_offset;
+        if (len > size - copied) len = size - copied;
+
+        if (j == open_file->last_block + 1) {
+            readahead_blocks(entry, j + 1);
+        }
+        open_file->last_block = j;
+
+        if (entry->block_positions[j] == HOLE_BLOCK) {
+            memset(buf + copied, 0, len);
+        } else {
+            long index = get_block(entry->block_positions[j]);
+            if (index == -1) return copied > 0 ? copied : -EIO;
+            memcpy(buf + copied, cache[index].block->data + block_offset, len);
+            put_block(index);
+        }
+        copied += len;
+    }
+
+    return copied;
+}
+
+int star_release(const char *path, struct fuse_file_info *fi) {
+    free((OpenFile *) fi->fh);
+    return 0;
+}
+
+const struct fuse_opt star_options[] = {
+    {"max_memory=%s", offsetof(MountOptions, max_memory), 1},
+    FUSE_OPT_END
+};
+
+const struct fuse_operations star_operations = {
+    .getattr = star_getattr,
+    .readdir = star_readdir,
+    .open = star_open,
+    .read = star_read,
+    .release = star_release,
+};
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Uso: %s <archivo_empacado> <punto_de_montaje> [opciones de FUSE]\n", argv[0]);
+        return 1;
+    }
+
+    tar_fd = open(argv[1], O_RDONLY);
+    if (tar_fd == -1) {
+        printf("Error al abrir el archivo TAR para lectura.\n");
+        return 1;
+    }
+
+    fat = malloc(sizeof(FAT));
+    if (fat == NULL || load_fat_snapshot(tar_fd, fat) == -1) {
+        printf("Error al leer la FAT del archivo %s, no es un TAR de star compatible.\n", argv[1]);
+        return 1;
+    }
+
+    // Quitar el nombre del tar de los argumentos que recibe FUSE
+    argv[1] = argv[0];
+    struct fuse_args args = FUSE_ARGS_INIT(argc - 1, argv + 1);
+    MountOptions options = {NULL};
+    if (fuse_opt_parse(&args, &options, star_options, NULL) == -1) return 1;
+
+    long max_memory = options.max_memory != NULL ? parse_memory_size(options.max_memory) : DEFAULT_MAX_MEMORY;
+    // Cada bloque de la cache ocupa ademas su entrada y hasta dos posiciones en la tabla de hash
+    long block_memory = sizeof(Block) + sizeof(CacheEntry) + 2 * sizeof(long);
+    cache_blocks = (max_memory - (long) sizeof(FAT)) / block_memory;
+    if (max_memory == -1 || cache_blocks < 1) {
+        printf("El valor de max_memory debe ser de al menos %zu bytes.\n", sizeof(FAT) + block_memory);
+        return 1;
+    }
+
+    long buckets_num = 1;
+    while (buckets_num < cache_blocks) buckets_num *= 2;
+    cache_buckets_mask = buckets_num - 1;
+    cache_buckets = malloc(buckets_num * sizeof(long));
+    cache = calloc(cache_blocks, sizeof(CacheEntry));
+    if (cache == NULL || cache_buckets == NULL) return 1;
+    for (long i = 0; i < buckets_num; i++) cache_buckets[i] = -1;
+    for (long i = 0; i < cache_blocks; i++) {
+        cache[i].position = HOLE_BLOCK;
+        lru_push_front(i);
+    }
+
+    int result = fuse_main(args.argc, args.argv, &star_operations, NULL);
+    fuse_opt_free_args(&args);
+    return result;
+}
+
+//gcc star-mount.c star-lib.c -o star-mount `pkg-config fuse3 --cflags --libs`
+
+//---Montar tar---
+//./star -cvf prueba-paq.tar prueba.txt prueba2.docx prueba3.pdf
+//mkdir montaje
+//./star-mount prueba-paq.tar montaje
+//./star-mount prueba-paq.tar montaje -o max_memory=64M
+//cat montaje/prueba.txt
+//fusermount3 -u montaje
@@ -1,37 +1,308 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
 
-#define BLOCK_SIZE (256 * 1024) 
-#define MAX_FILES 100 
-#define MAX_FILENAME_LENGTH 256
-#define MAX_BLOCKS_PER_FILE 64 //Cambiar en caso de necesitar usar archivos mas grandes
-#define MAX_BLOCKS MAX_BLOCKS_PER_FILE * MAX_FILES
+#include "star.h"
 
-typedef struct {
-    char filename[MAX_FILENAME_LENGTH];
-    long file_size;
-    long block_positions[MAX_BLOCKS_PER_FILE];
-    long blocks_num; 
-} FileEntry;
+// La operacion que mas memoria necesita es --diff con un solo hilo: FAT, nombres del directorio,
+// dos buffers de bloque y un margen para alineacion y las estructuras del hilo
+#define MIN_MEMORY (sizeof(FAT) + MAX_FILES * (sizeof(char *) + MAX_FILENAME_LENGTH) + 2 * sizeof(Block) + 1024)
 
 typedef struct {
-    FileEntry files[MAX_FILES];
-    long files_num;
-    long free_blocks[MAX_BLOCKS];
-    long free_blocks_num;
-} FAT;
+    char *base;
+    size_t size;
+    size_t used;
+} Arena;
+
+// Toda la memoria de trabajo (FAT y buffers de bloques) sale de esta arena, su tamaño es --max-memory
+Arena arena;
+
+void arena_init(size_t size) {
+    arena.base = malloc(size);
+    arena.size = size;
+    arena.used = 0;
+    if (arena.base == NULL) {
+        fprintf(stderr, "Error al reservar %zu bytes de memoria\n", size);
+        exit(1);
+    }
+}
 
-typedef struct {
-    unsigned char data[BLOCK_SIZE];
-} Block; 
+void *arena_alloc(size_t size) {
+    size_t start = (arena.used + 63) & ~(size_t) 63;
+    if (start + size > arena.size) {
+        fprintf(stderr, "Error: memoria insuficiente, aumente --max-memory (minimo %zu bytes)\n", MIN_MEMORY);
+        exit(1);
+    }
+    arena.used = start + size;
+    return arena.base + start;
+}
+
+long arena_blocks_available(long max_blocks) {
+    // Cantidad de buffers de bloque que caben en lo que queda de la arena, al menos uno
+    size_t start = (arena.used + 63) & ~(size_t) 63;
+    long blocks = start < arena.size ? (arena.size - start) / sizeof(Block) : 0;
+    if (blocks > max_blocks) blocks = max_blocks;
+    return blocks > 0 ? blocks : 1;
+}
+
+// Final del tar en modo log (--log), 0 si se reutilizan bloques libres
+long log_tail = 0;
+long log_reserved_end = 0;
+
+bool lock_range(FILE *tar_file, short type, long start, long len) {
+    // Sin bloqueo no se puede seguir, los escritores no quedarian serializados ni los lectores protegidos
+    if (lock_fd_range(fileno(tar_file), type, start, len) == 0) return true;
+    fprintf(stderr, "Error al bloquear el archivo TAR.\n");
+    return false;
+}
+
+bool readers_before(FILE *tar_file, long generation) {
+    // Verifica si algun lector tiene fijada una generacion anterior a la dada
+    if (generation <= 0) return false;
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = LOCK_READERS_OFFSET;
+    lock.l_len = generation;
+    if (fcntl(fileno(tar_file), F_OFD_GETLK, &lock) == -1) return true;
+    return lock.l_type != F_UNLCK;
+}
+
+bool read_fat_header(FILE *tar_file, FAT *fat) {
+    // Rechaza archivos que no son de star o que tienen otra version del formato
+    fseek(tar_file, 0, SEEK_SET);
+    if (fread(fat, sizeof(FAT), 1, tar_file) != 1 || fat->magic != STAR_MAGIC || fat->version != STAR_VERSION) {
+        fprintf(stderr, "Error: el archivo no es un TAR de star o su formato no es compatible.\n");
+        return false;
+    }
+    return true;
+}
+
+bool replay_fat_log(FILE *tar_file, FAT *fat) {
+    if (replay_log(fileno(tar_file), fat) == -1) {
+        fprintf(stderr, "Error al leer el log del archivo TAR.\n");
+        return false;
+    }
+    return true;
+}
+
+bool read_fat_snapshot(FILE *tar_file, FAT *fat) {
+    // Lee la FAT y fija su generacion, los bloques que usa no se reutilizan mientras se lea
+    if (!lock_range(tar_file, F_RDLCK, LOCK_HEADER_OFFSET, 1)) return false;
+    bool ok = read_fat_header(tar_file, fat) && replay_fat_log(tar_file, fat)
+              && lock_range(tar_file, F_RDLCK, LOCK_READERS_OFFSET + fat->generation, 1);
+    lock_range(tar_file, F_UNLCK, LOCK_HEADER_OFFSET, 1);
+    return ok;
+}
+
+bool begin_write(FILE *tar_file, FAT *fat) {
+    // Solo un escritor a la vez; los lectores siguen trabajando con su version de la FAT
+    if (!lock_range(tar_file, F_WRLCK, LOCK_WRITER_OFFSET, 1)) return false;
+    // Si el log no se puede leer no se escribe nada, un checkpoint lo borraria
+    return read_fat_header(tar_file, fat) && replay_fat_log(tar_file, fat);
+}
+
+bool wait_for_readers(FILE *tar_file, bool may_wait) {
+    // Bloquea la FAT y todas las generaciones. Si hay lectores activos (star-mount los mantiene hasta
+    // desmontar) avisa antes de esperarlos, o falla si may_wait es false
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = LOCK_HEADER_OFFSET;
+    lock.l_len = 0;
+    if (fcntl(fileno(tar_file), F_OFD_SETLK, &lock) == 0) return true;
+    if (errno != EAGAIN && errno != EACCES) {
+        fprintf(stderr, "Error al bloquear el archivo TAR.\n");
+        return false;
+    }
+    if (!may_wait) {
+        fprintf(stderr, "Error: hay lectores usando versiones anteriores del archivo TAR.\n");
+        return false;
+    }
+    fprintf(stderr, "Esperando a que terminen los lectores del archivo TAR...\n");
+    return lock_range(tar_file, F_WRLCK, LOCK_HEADER_OFFSET, 0);
+}
+
+void reclaim_pending_blocks(FILE *tar_file, FAT *fat) {
+    // Pasar a la lista de libres los bloques que ya ningun lector puede estar usando
+    long kept = 0;
+    for (long i = 0; i < fat->pending_blocks_num; i++) {
+        if (readers_before(tar_file, fat->pending_generations[i])) {
+            fat->pending_blocks[kept] = fat->pending_blocks[i];
+            fat->pending_generations[kept] = fat->pending_generations[i];
+            kept++;
+        } else if (fat->free_blocks_num < MAX_BLOCKS) {
+            fat->free_blocks[fat->free_blocks_num++] = fat->pending_blocks[i];
+        } else {
+            // Lista de libres llena, el bloque sigue pendiente
+            fat->pending_blocks[kept] = fat->pending_blocks[i];
+            fat->pending_generations[kept] = fat->pending_generations[i];
+            kept++;
+        }
+    }
+    fat->pending_blocks_num = kept;
+}
+
+bool release_block(FILE *tar_file, FAT *fat, long block_position) {
+    if (block_position == HOLE_BLOCK) return true;
+
+    if (fat->pending_blocks_num == MAX_BLOCKS) {
+        // Lista de pendientes llena: solo se pueden liberar si no quedan lectores, no se espera por ellos
+        if (!wait_for_readers(tar_file, false)) return false;
+        reclaim_pending_blocks(tar_file, fat);
+        if (fat->pending_blocks_num == MAX_BLOCKS) return false;
+    }
+
+    // El bloque queda pendiente hasta que no haya lectores de generaciones anteriores al commit
+    fat->pending_blocks[fat->pending_blocks_num] = block_position;
+    fat->pending_generations[fat->pending_blocks_num] = fat->generation + 1;
+    fat->pending_blocks_num++;
+    return true;
+}
 
-char* processFileOption(int argc, char *argv[]) {
+bool release_entry_blocks(FILE *tar_file, FAT *fat, FileEntry *entry) {
+    for (long k = 0; k < entry->blocks_num; k++) {
+        if (!release_block(tar_file, fat, entry->block_positions[k])) {
+            fprintf(stderr, "Error: demasiados bloques liberados pendientes, no se guardaron los cambios.\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool commit_fat(FILE *tar_file, FAT *fat) {
+    // Los bloques de datos se escriben antes que la nueva version de la FAT.
+    // La FAT completa ya incluye las entradas del log, asi que funciona como checkpoint
+    fflush(tar_file);
+    if (!lock_range(tar_file, F_WRLCK, LOCK_HEADER_OFFSET, 1)) return false;
+    fat->generation++;
+    fat->log_last = 0;
+    fat->log_records_num = 0;
+    fseek(tar_file, 0, SEEK_SET);
+    fwrite(fat, sizeof(FAT), 1, tar_file);
+    fflush(tar_file);
+    lock_range(tar_file, F_UNLCK, LOCK_HEADER_OFFSET, 1);
+    return true;
+}
+
+bool block_is_zero(const Block *block, long len) {
+    // Comparar el bloque contra si mismo desplazado un byte, memcmp esta vectorizado
+    return len == 0 || (block->data[0] == 0 && memcmp(block->data, block->data + 1, len - 1) == 0);
+}
+
+long next_data_offset(FILE *file, long offset) {
+    // Inicio de los siguientes datos reales del archivo, saltando los huecos
+    long data_offset = lseek(fileno(file), offset, SEEK_DATA);
+    if (data_offset == -1) return errno == ENXIO ? LONG_MAX : offset;
+    return data_offset;
+}
+
+bool commit_log(FILE *tar_file, FAT *fat, long first_entry) {
+    // Escribe un registro con las entradas nuevas al final del tar y solo actualiza el inicio de la FAT
+    LogRecord record = {LOG_MAGIC, fat->generation + 1, fat->log_last, fat->files_num - first_entry};
+    fseek(tar_file, log_tail, SEEK_SET);
+    fwrite(&record, sizeof(LogRecord), 1, tar_file);
+    fwrite(&fat->files[first_entry], sizeof(FileEntry), record.entries_num, tar_file);
+    fflush(tar_file);
+
+    if (!lock_range(tar_file, F_WRLCK, LOCK_HEADER_OFFSET, 1)) return false;
+    fat->generation++;
+    fat->log_last = log_tail;
+    fat->log_records_num++;
+    pwrite(fileno(tar_file), fat, offsetof(FAT, files), 0);
+    lock_range(tar_file, F_UNLCK, LOCK_HEADER_OFFSET, 1);
+    return true;
+}
+
+long allocate_log_block(FILE *tar_file, int verbose) {
+    // En modo log los bloques siempre van al final, reservando espacio de a LOG_GROWTH_CHUNK
+    long block_position = log_tail;
+    log_tail += BLOCK_SIZE;
+    if (log_tail > log_reserved_end) {
+        long reserved_end = (log_tail + LOG_GROWTH_CHUNK - 1) / LOG_GROWTH_CHUNK * LOG_GROWTH_CHUNK;
+        if (verbose >= 2) printf("Reservando espacio hasta la posición %zu\n", reserved_end);
+        fallocate(fileno(tar_file), FALLOC_FL_KEEP_SIZE, block_position, reserved_end - block_position);
+        log_reserved_end = reserved_end;
+    }
+    return block_position;
+}
+
+long allocate_block(FILE *tar_file, FAT *fat, int verbose) {
+    if (log_tail != 0) return allocate_log_block(tar_file, verbose);
+
+    while (fat->free_blocks_num > 0) {
+        long block_position = fat->free_blocks[--fat->free_blocks_num];
+        if (block_position != 0) return block_position;
+    }
+
+    // Si no hay bloques libres
+    if (verbose >= 2) printf("No hay bloques libres, expandiendo el archivo\n");
+    fseek(tar_file, 0, SEEK_END); 
+    long current_size = ftell(tar_file); 
+    ftruncate(fileno(tar_file), current_size + BLOCK_SIZE); 
+    if (verbose >= 2) printf("Nuevo bloque libre en la posición %zu\n", current_size);
+    return current_size;
+}
+
+void store_file_blocks(FILE *tar_file, FAT *fat, FileEntry *entry, FILE *file_received, long file_size, int verbose) {
+    // Guardar el archivo bloque por bloque, los bloques de ceros quedan como huecos
+    size_t arena_mark = arena.used;
+    Block *block = arena_alloc(sizeof(Block));
+    long offset = 0;
+    long data_offset = next_data_offset(file_received, 0);
+
+    while (offset < file_size) {
+        long block_len = (file_size - offset < BLOCK_SIZE) ? file_size - offset : BLOCK_SIZE;
+        long block_position = HOLE_BLOCK;
+
+        if (data_offset < offset + block_len) {
+            fseek(file_received, offset, SEEK_SET);
+            long bytes_read = fread(block, 1, block_len, file_received);
+            if (bytes_read <= 0) break;
+            block_len = bytes_read;
+
+            if (!block_is_zero(block, block_len)) {
+                block_position = allocate_block(tar_file, fat, verbose);
+                if (block_len < sizeof(Block)) {
+                    // Si no se lee un bloque completo
+                    memset((char*)block + block_len, 0, sizeof(Block) - block_len); // Rellenar con 0s
+                }
+                fseek(tar_file, block_position, SEEK_SET); 
+                fwrite(block, sizeof(Block), 1, tar_file); 
+            }
+        }
+
+        entry->block_positions[entry->blocks_num++] = block_position;
+        entry->file_size += block_len;
+        offset += block_len;
+        if (data_offset < offset) data_offset = next_data_offset(file_received, offset);
+
+        if (verbose >= 2) {
+            if (block_position == HOLE_BLOCK) printf("Bloque %zu del archivo %s es un hueco, no se almacena\n", entry->blocks_num, entry->filename);
+            else printf("Escribiendo bloque %zu para archivo %s\n", block_position, entry->filename);
+        }
+    }
+
+    arena.used = arena_mark;
+}
+
+char* processFileOption(int argc, char *argv[], int i) {
+    // i es la posicion de la opcion -f/--file, el nombre es el siguiente argumento que no sea opcion
     char *archive_name = NULL;
-    int i;
 
     int next_arg_index = i + 1;
     while (next_arg_index < argc && argv[next_arg_index][0] == '-') {
@@ -58,20 +329,30 @@ void pack_files_to_tar(const char *tar_filename, char **filenames, int files_num
     if (verbose == 1) printf("Creando archivo %s\n", tar_filename);
     else if (verbose >= 2) printf("Comenzando a crear el archivo %s\n", tar_filename);
 
-    FILE *tar_file = fopen(tar_filename, "wb");
+    // No se trunca al abrir, primero hay que esperar a los lectores del tar anterior
+    int tar_fd = open(tar_filename, O_RDWR | O_CREAT, 0644);
+    FILE *tar_file = tar_fd == -1 ? NULL : fdopen(tar_fd, "w+b");
 
     if (tar_file == NULL) {
         fprintf(stderr, "Error al abrir el archivo %s\n", tar_filename);
         exit(1);
     }
 
-    FAT fat;
-    memset(&fat, 0, sizeof(FAT)); 
+    if (!lock_range(tar_file, F_WRLCK, LOCK_WRITER_OFFSET, 1) || !wait_for_readers(tar_file, true)) {
+        fclose(tar_file);
+        exit(1);
+    }
+    ftruncate(tar_fd, 0);
+
+    FAT *fat = arena_alloc(sizeof(FAT));
+    memset(fat, 0, sizeof(FAT)); 
+    fat->magic = STAR_MAGIC;
+    fat->version = STAR_VERSION;
 
-    fat.free_blocks[0] = sizeof(FAT); 
-    fat.free_blocks_num = 1; 
+    fat->free_blocks[0] = sizeof(FAT); 
+    fat->free_blocks_num = 1; 
 
-    fwrite(&fat, sizeof(FAT), 1, tar_file); 
+    fwrite(fat, sizeof(FAT), 1, tar_file); 
 
     for (int i = 0; i < files_num; i++) {
         FILE *file_received = fopen(filenames[i], "rb"); 
@@ -82,11 +363,6 @@ void pack_files_to_tar(const char *tar_filename, char **filenames, int files_num
 
         if (verbose >= 2) printf("Agregando archivo %s\n", filenames[i]);
 
-        long file_size = 0;
-        long block_num = 0;
-        Block block;
-        long bytes_read;
-
         // Verificar el tamaño del archivo
         fseek(file_received, 0, SEEK_END); 
         long check_size = ftell(file_received); 
@@ -98,74 +374,31 @@ void pack_files_to_tar(const char *tar_filename, char **filenames, int files_num
             return; 
         }
 
-        while ((bytes_read = fread(&block, 1, sizeof(Block), file_received)) > 0) {
-            // Mientras se pueda leer un bloque del archivo
-            FAT * fat_point = &fat;
-            long block_position = -1;
-            for (long i = 0; i < fat_point->free_blocks_num; i++) {
-                if (fat_point->free_blocks[i] != 0) {
-                    long free_block = fat_point->free_blocks[i];
-                    fat_point->free_blocks[i] = 0; 
-                    block_position = free_block;
-                }
-            }
-            if (block_position == -1) {
-                // Si no hay bloques libres
-                if (verbose >= 2) printf("No hay bloques libres, expandiendo el archivo\n");
-                fseek(tar_file, 0, SEEK_END); 
-                long current_size = ftell(tar_file); 
-                long expanded_size = current_size + BLOCK_SIZE; 
-                ftruncate(fileno(tar_file), expanded_size); 
-                fat_point->free_blocks[fat_point->free_blocks_num++] = current_size; 
-                for (long i = 0; i < fat_point->free_blocks_num; i++) {
-                    if (fat_point->free_blocks[i] != 0) {
-                        long free_block = fat_point->free_blocks[i];
-                        fat_point->free_blocks[i] = 0; 
-                        block_position = free_block;
-                    }
-                }
-                if (verbose >= 2) printf("Nuevo bloque libre en la posición %zu\n", block_position);
-            }
-
-            if (bytes_read < sizeof(Block)) {
-                // Si no se lee un bloque completo
-                memset((char*)&block + bytes_read, 0, sizeof(Block) - bytes_read); // Rellenar con 0s
-            }
-
-            fseek(tar_file, block_position, SEEK_SET); 
-            fwrite(&block, sizeof(Block), 1, tar_file); 
-            for (long j = 0; j < fat_point->files_num; j++) { 
-                if (strcmp(fat_point->files[j].filename, filenames[i]) == 0) { 
-                    fclose(file_received);
-                    fclose(tar_file);
-                    printf("Archivo %s ya existente en tar\n", filenames[i]);
-                    printf("Creacion del tar con archivos cancelada, se creo un tar vacio\n");
-                    return;
-                }
-            }
-
-            FileEntry new_entry;
-            strncpy(new_entry.filename, filenames[i], MAX_FILENAME_LENGTH); 
-            new_entry.file_size = file_size + bytes_read; 
-            new_entry.block_positions[0] = block_position; 
-            new_entry.blocks_num = 1; 
-            fat_point->files[fat_point->files_num++] = new_entry; 
-
-            file_size += bytes_read;
-            block_num++;
-
-            if (verbose >= 2) {
-                printf("Escribiendo bloque %zu para archivo %s\n", block_position, filenames[i]);
+        for (long j = 0; j < fat->files_num; j++) { 
+            if (strcmp(fat->files[j].filename, filenames[i]) == 0) { 
+                fclose(file_received);
+                fclose(tar_file);
+                printf("Archivo %s ya existente en tar\n", filenames[i]);
+                printf("Creacion del tar con archivos cancelada, se creo un tar vacio\n");
+                return;
             }
         }
 
+        FileEntry *new_entry = &fat->files[fat->files_num++];
+        memset(new_entry, 0, sizeof(FileEntry));
+        strncpy(new_entry->filename, filenames[i], MAX_FILENAME_LENGTH - 1); 
+        store_file_blocks(tar_file, fat, new_entry, file_received, check_size, verbose);
+        long file_size = new_entry->file_size;
+
         if (verbose == 1 || verbose >= 2) printf("Tamaño del archivo %s: %zu bytes\n", filenames[i], file_size);
 
         fclose(file_received);
     }
 
-    fseek(tar_file, 0, SEEK_SET); 
-    fwrite(&fat, sizeof(FAT), 1, tar_file); 
+    if (!commit_fat(tar_file, fat)) {
+        fclose(tar_file);
+        exit(1);
+    }
     fclose(tar_file);
 
     if (verbose >= 2) {
@@ -185,12 +418,18 @@ void extract_files_from_tar(const char *tar_filename, int verbose) {
         return;
     }
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, tar_file);
+    FAT *fat = arena_alloc(sizeof(FAT));
+    if (!read_fat_snapshot(tar_file, fat)) {
+        fclose(tar_file);
+        return;
+    }
+
+    long blocks_num = arena_blocks_available(MAX_BLOCKS_PER_FILE);
+    Block *blocks = arena_alloc(blocks_num * sizeof(Block));
 
     // Iterar sobre cada archivo en la FAT y extraerlo
-    for (long i = 0; i < fat.files_num; i++) {
-        FileEntry file_entry = fat.files[i];
+    for (long i = 0; i < fat->files_num; i++) {
+        FileEntry file_entry = fat->files[i];
         FILE *file_found = fopen(file_entry.filename, "wb");
         if (file_found == NULL) {
             printf("Error al crear el archivo de salida: %s\n", file_entry.filename);
@@ -202,18 +441,30 @@ void extract_files_from_tar(const char *tar_filename, int verbose) {
         }
 
         long file_size = 0;
-        // Iterar sobre cada bloque del archivo y escribirlo en el archivo de salida
-        for (long j = 0; j < file_entry.blocks_num; j++) {
-            Block block;
-            fseek(tar_file, file_entry.block_positions[j], SEEK_SET);
-            fread(&block, sizeof(Block), 1, tar_file);
+        // Iterar sobre los bloques del archivo y escribirlos en el archivo de salida,
+        // los bloques seguidos en el tar se leen juntos hasta llenar los buffers disponibles
+        for (long j = 0; j < file_entry.blocks_num; ) {
+            long run = 1;
+            if (file_entry.block_positions[j] != HOLE_BLOCK) run = contiguous_blocks(&file_entry, j, blocks_num);
+
+            long bytes_to_write = (file_size + run * sizeof(Block) > file_entry.file_size) ? file_entry.file_size - file_size : run * sizeof(Block);
 
-            long bytes_to_write = (file_size + sizeof(Block) > file_entry.file_size) ? file_entry.file_size - file_size : sizeof(Block);
-            fwrite(&block, 1, bytes_to_write, file_found);
+            if (file_entry.block_positions[j] == HOLE_BLOCK) {
+                // Los huecos no se escriben, se recrean saltando sobre ellos
+                fseek(file_found, bytes_to_write, SEEK_CUR);
+            } else {
+                fseek(tar_file, file_entry.block_positions[j], SEEK_SET);
+                fread(blocks, sizeof(Block), run, tar_file);
+                fwrite(blocks, 1, bytes_to_write, file_found);
+            }
 
             file_size += bytes_to_write;
+            j += run;
         }
 
+        // Fijar el tamaño final por si el archivo termina en un hueco
+        fflush(file_found);
+        ftruncate(fileno(file_found), file_entry.file_size);
         fclose(file_found);
 
         if (verbose >= 2) {
@@ -230,6 +481,120 @@ void extract_files_from_tar(const char *tar_filename, int verbose) {
     }
 }
 
+bool write_all_iov(int fd, struct iovec *iov, int iov_num) {
+    // writev puede escribir menos de lo pedido (por ejemplo en un pipe), continuar donde quedo
+    while (iov_num > 0) {
+        ssize_t written = writev(fd, iov, iov_num);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        while (iov_num > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iov_num--;
+        }
+        if (iov_num > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+bool is_selected(const char *filename, char **filenames, int files_num) {
+    // Sin archivos indicados se seleccionan todos
+    if (files_num == 0) return true;
+    for (int i = 0; i < files_num; i++) {
+        if (strcmp(filenames[i], filename) == 0) return true;
+    }
+    return false;
+}
+
+void extract_files_to_stdout(const char *tar_filename, char **filenames, int files_num, int verbose) {
+    // Los mensajes van a stderr para no mezclarse con el contenido de los archivos
+    if (verbose == 1) fprintf(stderr, "Extrayendo archivos del archivo %s\n", tar_filename);
+    else if (verbose >= 2) fprintf(stderr, "Comenzando a extraer archivos del archivo %s a la salida estandar\n", tar_filename);
+
+    FILE *tar_file = fopen(tar_filename, "rb");
+    if (tar_file == NULL) {
+        fprintf(stderr, "Error al abrir el archivo TAR para lectura.\n");
+        return;
+    }
+
+    FAT *fat = arena_alloc(sizeof(FAT));
+    if (!read_fat_snapshot(tar_file, fat)) {
+        fclose(tar_file);
+        return;
+    }
+
+    long blocks_num = arena_blocks_available(MAX_BLOCKS_PER_FILE);
+    Block *blocks = arena_alloc(blocks_num * sizeof(Block));
+    struct iovec iov[MAX_BLOCKS_PER_FILE];
+
+    for (int i = 0; i < files_num; i++) {
+        bool found = false;
+        for (long j = 0; j < fat->files_num && !found; j++) {
+            found = strcmp(fat->files[j].filename, filenames[i]) == 0;
+        }
+        if (!found) fprintf(stderr, "El archivo %s no existe en el archivo TAR.\n", filenames[i]);
+    }
+
+    // Los archivos se escriben en el orden de la FAT
+    for (long i = 0; i < fat->files_num; i++) {
+        FileEntry *file_entry = &fat->files[i];
+        if (!is_selected(file_entry->filename, filenames, files_num)) continue;
+
+        if (verbose >= 2) fprintf(stderr, "Extrayendo archivo: %s\n", file_entry->filename);
+
+        long file_size = 0;
+        long j = 0;
+        while (j < file_entry->blocks_num) {
+            // Llenar los buffers, un pread por cada tramo de bloques seguidos, y escribirlos con un solo writev
+            int iov_num = 0;
+            long slot = 0;
+            while (j < file_entry->blocks_num && slot < blocks_num) {
+                long run = 1;
+                if (file_entry->block_positions[j] == HOLE_BLOCK) {
+                    memset(&blocks[slot], 0, sizeof(Block));
+                } else {
+                    run = contiguous_blocks(file_entry, j, blocks_num - slot);
+                    if (pread(fileno(tar_file), &blocks[slot], run * sizeof(Block), file_entry->block_positions[j]) != (ssize_t) (run * sizeof(Block))) {
+                        fprintf(stderr, "Error al leer el archivo %s del archivo TAR\n", file_entry->filename);
+                        fclose(tar_file);
+                        exit(1);
+                    }
+                }
+
+                long bytes_to_write = (file_size + run * sizeof(Block) > file_entry->file_size) ? file_entry->file_size - file_size : run * sizeof(Block);
+                iov[iov_num].iov_base = &blocks[slot];
+                iov[iov_num].iov_len = bytes_to_write;
+                iov_num++;
+
+                file_size += bytes_to_write;
+                slot += run;
+                j += run;
+            }
+
+            if (!write_all_iov(STDOUT_FILENO, iov, iov_num)) {
+                fprintf(stderr, "Error al escribir el archivo %s en la salida estandar\n", file_entry->filename);
+                fclose(tar_file);
+                exit(1);
+            }
+        }
+
+        if (verbose >= 2) fprintf(stderr, "Extracción del archivo %s completada.\n", file_entry->filename);
+    }
+
+    fclose(tar_file);
+
+    if (verbose >= 2) {
+        fprintf(stderr, "Extracción de archivos completada.\n");
+    } else if (verbose == 1) {
+        fprintf(stderr, "Archivos extraídos del archivo %s.\n", tar_filename);
+    }
+}
+
 void list_files_in_tar(const char *tar_filename, int verbose) {
     if (verbose == 1) printf("Listando archivos en el archivo %s\n", tar_filename);
     else if (verbose >= 2) printf("Comenzando a listar archivos en el archivo %s\n", tar_filename);
@@ -240,12 +605,15 @@ void list_files_in_tar(const char *tar_filename, int verbose) {
         return;
     }
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, tar_file);
+    FAT *fat = arena_alloc(sizeof(FAT));
+    if (!read_fat_snapshot(tar_file, fat)) {
+        fclose(tar_file);
+        return;
+    }
 
     // Iterar sobre cada archivo en la FAT y mostrar su información
-    for (long i = 0; i < fat.files_num; i++) {
-        FileEntry file_entry = fat.files[i];
+    for (long i = 0; i < fat->files_num; i++) {
+        FileEntry file_entry = fat->files[i];
         printf("Nombre: %s, Tamaño: %zu bytes\n", file_entry.filename, file_entry.file_size);
     }
 
@@ -258,7 +626,7 @@ void list_files_in_tar(const char *tar_filename, int verbose) {
     }
 }
 
-void add_file_to_tar(const char *tar_filename, char **filenames, int files_num, int verbose) {
+void add_file_to_tar(const char *tar_filename, char **filenames, int files_num, bool log_mode, int verbose) {
     if (verbose == 1) printf("Añadiendo archivos al archivo %s\n", tar_filename);
     else if (verbose >= 2) printf("Comenzando a añadir archivos al archivo %s\n", tar_filename);
 
@@ -268,18 +636,20 @@ void add_file_to_tar(const char *tar_filename, char **filenames, int files_num,
         return;
     }
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, tar_file);
+    FAT *fat = arena_alloc(sizeof(FAT));
+    if (!begin_write(tar_file, fat)) {
+        fclose(tar_file);
+        return;
+    }
+    long first_entry = fat->files_num;
 
-    // Buscar el último bloque ocupado en el archivo
-    long last_block = 0;
-    for (long i = 0; i < fat.files_num; i++) {
-        FileEntry file_entry = fat.files[i];
-        for (long j = 0; j < file_entry.blocks_num; j++) {
-            if (file_entry.block_positions[j] > last_block) {
-                last_block = file_entry.block_positions[j];
-            }
-        }
+    if (log_mode) {
+        // Escritura secuencial al final del tar, sin usar los bloques libres
+        fseek(tar_file, 0, SEEK_END);
+        log_tail = ftell(tar_file);
+        log_reserved_end = log_tail;
+    } else {
+        reclaim_pending_blocks(tar_file, fat);
     }
 
     // Iterar sobre los nuevos archivos y agregarlos al archivo TAR
@@ -291,10 +661,6 @@ void add_file_to_tar(const char *tar_filename, char **filenames, int files_num,
         }
 
         if (verbose >= 2) printf("Agregando archivo %s\n", filenames[i]);
-        long file_size = 0;
-        long block_num = 0;
-        Block block;
-        long bytes_read;
 
         // Verificar el tamaño del archivo
         fseek(file_received, 0, SEEK_END); 
@@ -307,75 +673,43 @@ void add_file_to_tar(const char *tar_filename, char **filenames, int files_num,
             return; 
         }
 
-        while ((bytes_read = fread(&block, 1, sizeof(Block), file_received)) > 0) {
-            // Mientras se pueda leer un bloque del archivo
-            FAT * fat_point = &fat;
-            long block_position = -1;
-            for (long i = 0; i < fat_point->free_blocks_num; i++) {
-                if (fat_point->free_blocks[i] != 0) {
-                    long free_block = fat_point->free_blocks[i];
-                    fat_point->free_blocks[i] = 0; 
-                    block_position = free_block;
-                }
-            }
-            if (block_position == -1) {
-                // Si no hay bloques libres
-                if (verbose >= 2) printf("No hay bloques libres, expandiendo el archivo\n");
-                fseek(tar_file, 0, SEEK_END); 
-                long current_size = ftell(tar_file); 
-                long expanded_size = current_size + BLOCK_SIZE; 
-                ftruncate(fileno(tar_file), expanded_size); 
-                fat_point->free_blocks[fat_point->free_blocks_num++] = current_size; 
-                for (long i = 0; i < fat_point->free_blocks_num; i++) {
-                    if (fat_point->free_blocks[i] != 0) {
-                        long free_block = fat_point->free_blocks[i];
-                        fat_point->free_blocks[i] = 0; 
-                        block_position = free_block;
-                    }
-                }
-                if (verbose >= 2) printf("Nuevo bloque libre en la posición %zu\n", block_position);
-            }
-
-            if (bytes_read < sizeof(Block)) {
-                // Si no se lee un bloque completo
-                memset((char*)&block + bytes_read, 0, sizeof(Block) - bytes_read); // Rellenar con 0s
-            }
-
-            fseek(tar_file, block_position, SEEK_SET); 
-            fwrite(&block, sizeof(Block), 1, tar_file); 
-            for (long j = 0; j < fat_point->files_num; j++) { 
-                if (strcmp(fat_point->files[j].filename, filenames[i]) == 0) { 
-                    fclose(file_received);
-                    fclose(tar_file);
-                    printf("Archivo %s ya existente en tar\n", filenames[i]);
-                    printf("Agregar archivo al tar cancelado\n");
-                    return;
-                }
-            }
-
-            FileEntry new_entry;
-            strncpy(new_entry.filename, filenames[i], MAX_FILENAME_LENGTH); 
-            new_entry.file_size = file_size + bytes_read; 
-            new_entry.block_positions[0] = block_position; 
-            new_entry.blocks_num = 1; 
-            fat_point->files[fat_point->files_num++] = new_entry; 
-
-            file_size += bytes_read;
-            block_num++;
-
-            if (verbose >= 2) {
-                printf("Escribiendo bloque %zu para archivo %s\n", block_position, filenames[i]);
+        for (long j = 0; j < fat->files_num; j++) { 
+            if (strcmp(fat->files[j].filename, filenames[i]) == 0) { 
+                fclose(file_received);
+                fclose(tar_file);
+                printf("Archivo %s ya existente en tar\n", filenames[i]);
+                printf("Agregar archivo al tar cancelado\n");
+                return;
             }
         }
 
+        FileEntry *new_entry = &fat->files[fat->files_num++];
+        memset(new_entry, 0, sizeof(FileEntry));
+        strncpy(new_entry->filename, filenames[i], MAX_FILENAME_LENGTH - 1); 
+        store_file_blocks(tar_file, fat, new_entry, file_received, check_size, verbose);
+        long file_size = new_entry->file_size;
+
         if (verbose >= 2) printf("Tamaño del archivo %s: %zu bytes\n", filenames[i], file_size);
 
         fclose(file_received);
     }
 
-    fseek(tar_file, 0, SEEK_SET); 
-    fwrite(&fat, sizeof(FAT), 1, tar_file); 
+    // Sin archivos nuevos no se escribe un registro vacio ni cambia la generacion
+    if (fat->files_num == first_entry) {
+        fclose(tar_file);
+        return;
+    }
+
+    bool committed;
+    if (log_mode && fat->log_records_num + 1 < LOG_CHECKPOINT_RECORDS) {
+        committed = commit_log(tar_file, fat, first_entry);
+    } else {
+        if (log_mode && verbose >= 2) printf("Integrando el log en la FAT\n");
+        committed = commit_fat(tar_file, fat);
+    }
+    log_tail = 0;
     fclose(tar_file);
+    if (!committed) return;
 
     if (verbose >= 2) {
         printf("Añadido completado.\n");
@@ -394,8 +728,11 @@ void delete_from_tar(const char *tar_filename, char **filenames, int files_num,
         return;
     }
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, tar_file);
+    FAT *fat = arena_alloc(sizeof(FAT));
+    if (!begin_write(tar_file, fat)) {
+        fclose(tar_file);
+        return;
+    }
 
     // Iterar sobre los archivos en filenames y eliminarlos del archivo TAR y de la FAT
     for (int i = 0; i < files_num; i++) {
@@ -403,23 +740,23 @@ void delete_from_tar(const char *tar_filename, char **filenames, int files_num,
         bool found = false;
 
         // Iterar sobre los archivos en la FAT y encontrar el archivo a eliminar
-        for (long j = 0; j < fat.files_num; j++) {
-            FileEntry *file_entry = &fat.files[j];
+        for (long j = 0; j < fat->files_num; j++) {
+            FileEntry *file_entry = &fat->files[j];
             if (strcmp(file_entry->filename, filename_to_delete) == 0) {
                 found = true;
 
-                // Eliminar bloques ocupados por el archivo de la lista de bloques libres
-                for (long k = 0; k < file_entry->blocks_num; k++) {
-                    long block_position = file_entry->block_positions[k];
-                    fat.free_blocks[fat.free_blocks_num++] = block_position;
+                // Liberar los bloques ocupados por el archivo
+                if (!release_entry_blocks(tar_file, fat, file_entry)) {
+                    fclose(tar_file);
+                    return;
                 }
 
                 // Mover las entradas restantes de la FAT para cerrar el espacio
-                for (long k = j; k < fat.files_num - 1; k++) {
-                    fat.files[k] = fat.files[k + 1];
+                for (long k = j; k < fat->files_num - 1; k++) {
+                    fat->files[k] = fat->files[k + 1];
                 }
 
-                fat.files_num--;
+                fat->files_num--;
                 break;
             }
         }
@@ -433,8 +770,10 @@ void delete_from_tar(const char *tar_filename, char **filenames, int files_num,
         }
     }
 
-    fseek(tar_file, 0, SEEK_SET);
-    fwrite(&fat, sizeof(FAT), 1, tar_file);
+    if (!commit_fat(tar_file, fat)) {
+        fclose(tar_file);
+        return;
+    }
 
     fclose(tar_file);
 
@@ -455,21 +794,32 @@ void defragment_tar(const char *tar_filename, int verbose) {
         return;
     }
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, tar_file);
+    FAT *fat = arena_alloc(sizeof(FAT));
+    if (!begin_write(tar_file, fat)) {
+        fclose(tar_file);
+        return;
+    }
+    // Los bloques se mueven de lugar, no puede haber lectores durante la desfragmentacion
+    if (!wait_for_readers(tar_file, true)) {
+        fclose(tar_file);
+        return;
+    }
+    fat->pending_blocks_num = 0;
 
+    Block *block = arena_alloc(sizeof(Block));
     long new_block_position = sizeof(FAT);
-    for (long i = 0; i < fat.files_num; i++) {
-        FileEntry *entry = &fat.files[i];
+    for (long i = 0; i < fat->files_num; i++) {
+        FileEntry *entry = &fat->files[i];
         long file_size = 0;
 
         for (long j = 0; j < entry->blocks_num; j++) {
-            Block block;
+            if (entry->block_positions[j] == HOLE_BLOCK) continue;
+
             fseek(tar_file, entry->block_positions[j], SEEK_SET);
-            fread(&block, sizeof(Block), 1, tar_file);
+            fread(block, sizeof(Block), 1, tar_file);
 
             fseek(tar_file, new_block_position, SEEK_SET);
-            fwrite(&block, sizeof(Block), 1, tar_file);
+            fwrite(block, sizeof(Block), 1, tar_file);
 
             entry->block_positions[j] = new_block_position;
             new_block_position += sizeof(Block);
@@ -485,15 +835,17 @@ void defragment_tar(const char *tar_filename, int verbose) {
         }
     }
 
-    fat.free_blocks_num = 0;
+    fat->free_blocks_num = 0;
     long remaining_space = new_block_position;
-    while (remaining_space < fat.free_blocks[fat.free_blocks_num - 1]) {
-        fat.free_blocks[fat.free_blocks_num++] = remaining_space;
+    while (remaining_space < fat->free_blocks[fat->free_blocks_num - 1]) {
+        fat->free_blocks[fat->free_blocks_num++] = remaining_space;
         remaining_space += sizeof(Block);
     }
 
-    fseek(tar_file, 0, SEEK_SET);
-    fwrite(&fat, sizeof(FAT), 1, tar_file);
+    if (!commit_fat(tar_file, fat)) {
+        fclose(tar_file);
+        return;
+    }
 
     ftruncate(fileno(tar_file), new_block_position);
 
@@ -516,34 +868,30 @@ void update_file_in_tar(const char *tar_filename, char **filenames, int files_nu
         return;
     }
 
-    FAT fat;
-    fread(&fat, sizeof(FAT), 1, tar_file);
+    FAT *fat = arena_alloc(sizeof(FAT));
+    if (!begin_write(tar_file, fat)) {
+        fclose(tar_file);
+        return;
+    }
+    reclaim_pending_blocks(tar_file, fat);
 
     for (int i = 0; i < files_num; i++) {
         char *filename_to_update = filenames[i];
         bool found = false;
+        bool updated = false;
 
-        for (long j = 0; j < fat.files_num; j++) {
-            FileEntry *file_entry = &fat.files[j];
+        for (long j = 0; j < fat->files_num; j++) {
+            FileEntry *file_entry = &fat->files[j];
             if (strcmp(file_entry->filename, filename_to_update) == 0) {
                 found = true;
 
-                for (long k = 0; k < file_entry->blocks_num; k++) {
-                    long block_position = file_entry->block_positions[k];
-                    fat.free_blocks[fat.free_blocks_num++] = block_position;
-                }
-
+                // Si el archivo nuevo no se puede leer se conserva la entrada vieja
                 FILE *file_received = fopen(filename_to_update, "rb");
                 if (file_received == NULL) {
                     fprintf(stderr, "Error al abrir el archivo %s\n", filename_to_update);
-                    continue;
+                    break;
                 }
 
-                long file_size = 0;
-                long block_num = 0;
-                Block block;
-                long bytes_read;
-
                 // Verificar el tamaño del archivo
                 fseek(file_received, 0, SEEK_END); 
                 long check_size = ftell(file_received); 
@@ -555,82 +903,38 @@ void update_file_in_tar(const char *tar_filename, char **filenames, int files_nu
                     return; 
                 }
 
-                while ((bytes_read = fread(&block, 1, sizeof(Block), file_received)) > 0) {
-                    FAT * fat_point = &fat;
-                    long block_position = -1;
-                    for (long i = 0; i < fat_point->free_blocks_num; i++) {
-                        if (fat_point->free_blocks[i] != 0) {
-                            long free_block = fat_point->free_blocks[i];
-                            fat_point->free_blocks[i] = 0; 
-                            block_position = free_block;
-                        }
-                    }
-                    if (block_position == -1) {
-                        if (verbose >= 2) printf("No hay bloques libres, expandiendo el archivo\n");
-                        fseek(tar_file, 0, SEEK_END); 
-                        long current_size = ftell(tar_file); 
-                        long expanded_size = current_size + BLOCK_SIZE; 
-                        ftruncate(fileno(tar_file), expanded_size); 
-                        fat_point->free_blocks[fat_point->free_blocks_num++] = current_size; 
-                        for (long i = 0; i < fat_point->free_blocks_num; i++) {
-                            if (fat_point->free_blocks[i] != 0) {
-                                long free_block = fat_point->free_blocks[i];
-                                fat_point->free_blocks[i] = 0; 
-                                block_position = free_block;
-                            }
-                        }
-                        if (verbose >= 2) printf("Nuevo bloque libre en la posición %zu\n", block_position);
-                    }
-
-                    if (bytes_read < sizeof(Block)) {
-                        memset((char*)&block + bytes_read, 0, sizeof(Block) - bytes_read);
-                    }
-
-                    fseek(tar_file, block_position, SEEK_SET); 
-                    fwrite(&block, sizeof(Block), 1, tar_file); 
-                    int repeated = 0;
-                    for (long k = 0; k < fat_point->files_num; k++) { 
-                        if (strcmp(fat_point->files[k].filename, filename_to_update) == 0) { 
-                            fat_point->files[k].block_positions[fat_point->files[k].blocks_num++] = block_position;  
-                            fat_point->files[k].file_size += bytes_read; 
-                            repeated++; 
-                        }
-                    }
-
-                    if (repeated == 0) {
-                        FileEntry new_entry;
-                        strncpy(new_entry.filename, filename_to_update, MAX_FILENAME_LENGTH); 
-                        new_entry.file_size = file_size + bytes_read; 
-                        new_entry.block_positions[0] = block_position; 
-                        new_entry.blocks_num = 1; 
-                        fat_point->files[fat_point->files_num++] = new_entry; 
-                    }
-
-                    file_size += bytes_read;
-                    block_num++;
-
-                    if (verbose >= 2) {
-                        printf("Escribiendo bloque %zu para archivo %s\n", block_position, filename_to_update);
-                    }
+                // Los bloques viejos no se sobreescriben, un lector puede estar usandolos
+                if (!release_entry_blocks(tar_file, fat, file_entry)) {
+                    fclose(file_received);
+                    fclose(tar_file);
+                    return; 
                 }
+                file_entry->blocks_num = 0;
+                file_entry->file_size = 0;
+
+                store_file_blocks(tar_file, fat, file_entry, file_received, check_size, verbose);
+                long file_size = file_entry->file_size;
 
                 if (verbose >= 2) printf("Tamaño del archivo %s: %zu bytes\n", filename_to_update, file_size);
 
                 fclose(file_received);
+                updated = true;
                 break;
             }
         }
 
         if (!found) {
             printf("El archivo %s no existe en el archivo TAR.\n", filename_to_update);
-        } else {
+        } else if (updated) {
             if (verbose == 1) printf("Archivo %s actualizado en el archivo TAR.\n", filename_to_update);
             else if (verbose >= 2) printf("Actualizado archivo %s en el archivo TAR.\n", filename_to_update);
         }
     }
 
-    fseek(tar_file, 0, SEEK_SET);
-    fwrite(&fat, sizeof(FAT), 1, tar_file);
+    if (!commit_fat(tar_file, fat)) {
+        fclose(tar_file);
+        return;
+    }
 
     fclose(tar_file);
 
@@ -641,6 +945,266 @@ void update_file_in_tar(const char *tar_filename, char **filenames, int files_nu
     }
 }
 
+#define DIFF_SAME 0
+#define DIFF_CHANGED 1
+#define DIFF_REMOVED 2
+#define DIFF_SKIPPED 3 // No esta entre los archivos indicados, no se compara
+
+typedef struct {
+    FILE *tar_file;
+    FAT *fat;
+    char *status; // Resultado DIFF_* de cada entrada de la FAT
+    long next_entry; // Siguiente entrada a comparar, compartida entre los hilos
+} DiffJob;
+
+typedef struct {
+    DiffJob *job;
+    Block *archive_block;
+    Block *disk_block;
+} DiffWorker;
+
+int compare_entry(FILE *tar_file, FileEntry *entry, Block *archive_block, Block *disk_block) {
+    // Compara la entrada contra el archivo en disco, primero el tamaño y despues bloque por bloque
+    int fd = open(entry->filename, O_RDONLY);
+    if (fd == -1) return DIFF_REMOVED;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size != entry->file_size) {
+        close(fd);
+        return DIFF_CHANGED;
+    }
+
+    int result = DIFF_SAME;
+    long offset = 0;
+    for (long j = 0; j < entry->blocks_num && result == DIFF_SAME; j++) {
+        long len = (offset + sizeof(Block) > entry->file_size) ? entry->file_size - offset : sizeof(Block);
+        if (pread(fd, disk_block, len, offset) != len) {
+            result = DIFF_CHANGED;
+        } else if (entry->block_positions[j] == HOLE_BLOCK) {
+            if (!block_is_zero(disk_block, len)) result = DIFF_CHANGED;
+        } else if (pread(fileno(tar_file), archive_block, len, entry->block_positions[j]) != len
+                   || memcmp(archive_block, disk_block, len) != 0) {
+            result = DIFF_CHANGED;
+        }
+        offset += len;
+    }
+
+    close(fd);
+    return result;
+}
+
+void *diff_worker(void *arg) {
+    DiffWorker *worker = arg;
+    DiffJob *job = worker->job;
+
+    long i;
+    while ((i = __atomic_fetch_add(&job->next_entry, 1, __ATOMIC_RELAXED)) < job->fat->files_num) {
+        if (job->status[i] == DIFF_SKIPPED) continue;
+        job->status[i] = compare_entry(job->tar_file, &job->fat->files[i], worker->archive_block, worker->disk_block);
+    }
+    return NULL;
+}
+
+void compare_entries_parallel(FILE *tar_file, FAT *fat, char *status) {
+    // Cada hilo necesita dos buffers de bloque, la cantidad de hilos depende de --max-memory
+    size_t thread_memory = 2 * sizeof(Block) + sizeof(DiffWorker) + sizeof(pthread_t) + 64;
+    size_t available = arena.size > arena.used + 256 ? arena.size - arena.used - 256 : 0;
+    long threads_num = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads_num > (long) (available / thread_memory)) threads_num = available / thread_memory;
+    if (threads_num > fat->files_num) threads_num = fat->files_num;
+    if (threads_num < 1) threads_num = 1;
+
+    DiffJob job = {tar_file, fat, status, 0};
+    DiffWorker *workers = arena_alloc(threads_num * sizeof(DiffWorker));
+    pthread_t *threads = arena_alloc(threads_num * sizeof(pthread_t));
+    for (long t = 0; t < threads_num; t++) {
+        workers[t].job = &job;
+        workers[t].archive_block = arena_alloc(sizeof(Block));
+        workers[t].disk_block = arena_alloc(sizeof(Block));
+    }
+
+    for (long t = 1; t < threads_num; t++) {
+        pthread_create(&threads[t], NULL, diff_worker, &workers[t]);
+    }
+    diff_worker(&workers[0]);
+    for (long t = 1; t < threads_num; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+int collect_directory_files(const char *tar_filename, char **names, int max_names) {
+    // Archivos regulares del directorio actual, sin incluir el propio tar
+    struct stat tar_st;
+    stat(tar_filename, &tar_st);
+
+    DIR *dir = opendir(".");
+    if (dir == NULL) return 0;
+
+    int names_num = 0;
+    struct dirent *dir_entry;
+    while ((dir_entry = readdir(dir)) != NULL) {
+        struct stat st;
+        if (stat(dir_entry->d_name, &st) == -1 || !S_ISREG(st.st_mode)) continue;
+        if (st.st_dev == tar_st.st_dev && st.st_ino == tar_st.st_ino) continue;
+        if (names_num == max_names) {
+            printf("Demasiados archivos en el directorio, se compararan solo los primeros %d\n", max_names);
+            break;
+        }
+        names[names_num] = arena_alloc(MAX_FILENAME_LENGTH);
+        strncpy(names[names_num], dir_entry->d_name, MAX_FILENAME_LENGTH - 1);
+        names[names_num][MAX_FILENAME_LENGTH - 1] = '\0';
+        names_num++;
+    }
+
+    closedir(dir);
+    return names_num;
+}
+
+void diff_tar(const char *tar_filename, char **filenames, int files_num, bool sync, int verbose) {
+    if (verbose == 1) printf("Comparando el archivo %s con el directorio\n", tar_filename);
+    else if (verbose >= 2) printf("Comenzando a comparar el archivo %s con el directorio\n", tar_filename);
+
+    FILE *tar_file = fopen(tar_filename, sync ? "r+b" : "rb");
+    if (tar_file == NULL) {
+        printf("Error al abrir el archivo TAR para lectura.\n");
+        return;
+    }
+
+    // Para sincronizar se compara con la FAT tomada como escritor, asi nadie la cambia mientras tanto
+    FAT *fat = arena_alloc(sizeof(FAT));
+    if (!(sync ? begin_write(tar_file, fat) : read_fat_snapshot(tar_file, fat))) {
+        fclose(tar_file);
+        return;
+    }
+
+    // Sin archivos indicados se compara contra todo el directorio actual
+    bool explicit_files = files_num > 0;
+    if (!explicit_files) {
+        filenames = arena_alloc(MAX_FILES * sizeof(char *));
+        files_num = collect_directory_files(tar_filename, filenames, MAX_FILES);
+    }
+
+    char status[MAX_FILES];
+    for (long i = 0; i < fat->files_num; i++) {
+        // Si se indicaron archivos, solo se comparan esos
+        status[i] = (explicit_files && !is_selected(fat->files[i].filename, filenames, files_num)) ? DIFF_SKIPPED : DIFF_SAME;
+    }
+    size_t arena_mark = arena.used;
+    compare_entries_parallel(tar_file, fat, status);
+    arena.used = arena_mark;
+
+    int changes = 0;
+    for (long i = 0; i < fat->files_num; i++) {
+        if (status[i] == DIFF_CHANGED) printf("Modificado: %s\n", fat->files[i].filename);
+        else if (status[i] == DIFF_REMOVED) printf("Eliminado: %s\n", fat->files[i].filename);
+        else if (status[i] == DIFF_SAME && verbose >= 2) printf("Sin cambios: %s\n", fat->files[i].filename);
+        if (status[i] == DIFF_CHANGED || status[i] == DIFF_REMOVED) changes++;
+    }
+
+    char *added[MAX_FILES];
+    int added_num = 0;
+    for (int i = 0; i < files_num; i++) {
+        bool found = false;
+        for (long j = 0; j < fat->files_num && !found; j++) {
+            found = strcmp(fat->files[j].filename, filenames[i]) == 0;
+        }
+        // Un nombre indicado que no esta en el tar solo es nuevo si existe como archivo regular
+        struct stat st;
+        if (!found && explicit_files && (stat(filenames[i], &st) == -1 || !S_ISREG(st.st_mode))) {
+            printf("No encontrado: %s\n", filenames[i]);
+            continue;
+        }
+        if (!found && added_num < MAX_FILES) {
+            added[added_num++] = filenames[i];
+            printf("Agregado: %s\n", filenames[i]);
+            changes++;
+        }
+    }
+
+    if (sync && changes > 0) {
+        reclaim_pending_blocks(tar_file, fat);
+
+        // Reescribir los archivos modificados y quitar los eliminados, compactando la FAT
+        long kept = 0;
+        for (long i = 0; i < fat->files_num; i++) {
+            FileEntry *file_entry = &fat->files[i];
+
+            // Abrir y verificar el archivo antes de liberar nada, si falla se conserva la entrada vieja
+            FILE *file_received = NULL;
+            long check_size = 0;
+            if (status[i] == DIFF_CHANGED) {
+                file_received = fopen(file_entry->filename, "rb");
+                if (file_received == NULL) {
+                    fprintf(stderr, "Error al abrir el archivo %s\n", file_entry->filename);
+                    status[i] = DIFF_SAME;
+                } else {
+                    fseek(file_received, 0, SEEK_END); 
+                    check_size = ftell(file_received); 
+                    if (check_size > 16 * 1024 * 1024) {
+                        printf("Error: El archivo %s excede el tamaño máximo permitido de 16MB.\n", file_entry->filename);
+                        fclose(file_received);
+                        status[i] = DIFF_SAME;
+                    }
+                }
+            }
+
+            if (status[i] == DIFF_CHANGED || status[i] == DIFF_REMOVED) {
+                if (!release_entry_blocks(tar_file, fat, file_entry)) {
+                    if (file_received != NULL) fclose(file_received);
+                    fclose(tar_file);
+                    return;
+                }
+                file_entry->blocks_num = 0;
+                file_entry->file_size = 0;
+            }
+
+            if (status[i] == DIFF_CHANGED) {
+                store_file_blocks(tar_file, fat, file_entry, file_received, check_size, verbose);
+                fclose(file_received);
+            }
+
+            if (status[i] != DIFF_REMOVED) fat->files[kept++] = *file_entry;
+        }
+        fat->files_num = kept;
+
+        for (int i = 0; i < added_num; i++) {
+            FILE *file_received = fopen(added[i], "rb");
+            if (file_received == NULL) {
+                fprintf(stderr, "Error al abrir el archivo %s\n", added[i]);
+                continue;
+            }
+            fseek(file_received, 0, SEEK_END); 
+            long check_size = ftell(file_received); 
+            if (check_size > 16 * 1024 * 1024 || fat->files_num == MAX_FILES) {
+                printf("Error: El archivo %s no se puede agregar al archivo TAR.\n", added[i]);
+                fclose(file_received);
+                continue;
+            }
+
+            FileEntry *new_entry = &fat->files[fat->files_num++];
+            memset(new_entry, 0, sizeof(FileEntry));
+            strncpy(new_entry->filename, added[i], MAX_FILENAME_LENGTH - 1); 
+            store_file_blocks(tar_file, fat, new_entry, file_received, check_size, verbose);
+            fclose(file_received);
+        }
+
+        // Todos los cambios quedan visibles en un solo commit de la FAT
+        if (!commit_fat(tar_file, fat)) {
+            fclose(tar_file);
+            return;
+        }
+    }
+
+    fclose(tar_file);
+
+    if (verbose >= 2) {
+        printf("Comparación completada, %d diferencias.\n", changes);
+    } else if (verbose == 1) {
+        if (sync) printf("Archivo %s sincronizado, %d cambios.\n", tar_filename, changes);
+        else printf("Archivo %s comparado, %d diferencias.\n", tar_filename, changes);
+    }
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         printf("Uso: ./star <opciones> <archivoSalida> <archivo1> <archivo2> ... <archivoN>\n");
@@ -651,6 +1215,9 @@ int main(int argc, char *argv[]) {
     char **files_to_use = NULL;
     int files_num = 0;
     int verbose = 0;
+    long max_memory = DEFAULT_MAX_MEMORY;
+    int to_stdout = 0;
+    bool log_mode = false;
 
     // Procesar opciones antes de llamar a la función correspondiente
     int i;
@@ -662,11 +1229,25 @@ int main(int argc, char *argv[]) {
                 // Forma completa de la opción
                 if (strcmp(option, "--verbose") == 0) {
                     verbose++;
+                } else if (strcmp(option, "--to-stdout") == 0) {
+                    to_stdout = 1;
+                } else if (strcmp(option, "--log") == 0) {
+                    log_mode = true;
                 } else if (strcmp(option, "--file") == 0) {
-                    archive_name = processFileOption(argc, argv);
+                    archive_name = processFileOption(argc, argv, i);
                     if (archive_name == NULL) {
                         return 1;
                     }
+                } else if (strncmp(option, "--max-memory=", 13) == 0) {
+                    max_memory = parse_memory_size(option + 13);
+                    if (max_memory == -1) {
+                        printf("El valor de --max-memory no es valido: %s\n", option + 13);
+                        return 1;
+                    }
+                    if (max_memory < (long) MIN_MEMORY) {
+                        printf("El valor de --max-memory debe ser de al menos %zu bytes.\n", MIN_MEMORY);
+                        return 1;
+                    }
                 }
             } else {
                 // Forma abreviada de la opción
@@ -677,8 +1258,11 @@ int main(int argc, char *argv[]) {
                         case 'v':
                             verbose++;
                             break;
+                        case 'O':
+                            to_stdout = 1;
+                            break;
                         case 'f':
-                            archive_name = processFileOption(argc, argv);
+                            archive_name = processFileOption(argc, argv, i);
                             if (archive_name == NULL) {
                                 return 1;
                             }
@@ -694,6 +1278,8 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    arena_init(max_memory);
+
     //Archivos a usar
     for (i = 1; i < argc; i++) {
         if (strcmp(argv[i], archive_name) == 0) {
@@ -724,14 +1310,21 @@ int main(int argc, char *argv[]) {
                     list_files_in_tar(archive_name, verbose);
                     return 0;
                 }else if (strcmp(option, "--append") == 0) {
-                    add_file_to_tar(archive_name, files_to_use, files_num, verbose);
+                    add_file_to_tar(archive_name, files_to_use, files_num, log_mode, verbose);
                     return 0;
                 }else if (strcmp(option, "--extract") == 0) {
-                    extract_files_from_tar(archive_name, verbose);
+                    if (to_stdout) extract_files_to_stdout(archive_name, files_to_use, files_num, verbose);
+                    else extract_files_from_tar(archive_name, verbose);
                     return 0;
                 }else if (strcmp(option, "--delete") == 0) {
                     delete_from_tar(archive_name, files_to_use, files_num, verbose);
                     return 0;
+                }else if (strcmp(option, "--diff") == 0) {
+                    diff_tar(archive_name, files_to_use, files_num, false, verbose);
+                    return 0;
+                }else if (strcmp(option, "--sync") == 0) {
+                    diff_tar(archive_name, files_to_use, files_num, true, verbose);
+                    return 0;
                 }else if (strcmp(option, "--pack") == 0) {
                     defragment_tar(archive_name, verbose);
                     return 0;
@@ -753,10 +1346,11 @@ int main(int argc, char *argv[]) {
                             list_files_in_tar(archive_name, verbose);
                             return 0;
                         case 'r':
-                            add_file_to_tar(archive_name, files_to_use, files_num, verbose);
+                            add_file_to_tar(archive_name, files_to_use, files_num, log_mode, verbose);
                             return 0;
                         case 'x':
-                            extract_files_from_tar(archive_name, verbose);
+                            if (to_stdout) extract_files_to_stdout(archive_name, files_to_use, files_num, verbose);
+                            else extract_files_from_tar(archive_name, verbose);
                             return 0;
                         case 'p':
                             defragment_tar(archive_name, verbose);
@@ -770,7 +1364,7 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
-//gcc star.c -o star
+//gcc star.c star-lib.c -o star -lpthread
 
 //---Pruebas---
 
@@ -785,6 +1379,10 @@ int main(int argc, char *argv[]) {
 //./star -cvf prueba-paq.tar prueba.txt prueba2.docx prueba3.pdf
 //./star -xvf prueba-paq.tar
 
+//---Extraer archivos a la salida estandar---
+//./star -xOf prueba-paq.tar prueba.txt | wc -c
+//./star --extract --to-stdout --file prueba-paq.tar > todo.bin
+
 //---Listar contenido del tar---
 //./star -cvf prueba-paq.tar prueba.txt prueba2.docx prueba3.pdf
 //./star -tvf prueba-paq.tar
@@ -793,6 +1391,11 @@ int main(int argc, char *argv[]) {
 //./star -cvf prueba-paq.tar prueba.txt prueba2.docx
 //./star -rvf prueba-paq.tar prueba3.pdf
 
+//---Agregar en modo log (escritura secuencial al final del tar)---
+//./star -cvf prueba-paq.tar prueba.txt
+//./star --log -rvf prueba-paq.tar prueba2.docx
+//./star --log -rvf prueba-paq.tar prueba3.pdf
+
 //---Actualizar algun archivo del tar---
 //./star -cvf prueba-paq.tar prueba.txt prueba2.docx prueba3.pdf
 //./star -uvf prueba-paq.tar prueba.txt
@@ -805,3 +1408,16 @@ int main(int argc, char *argv[]) {
 //./star -cvf prueba-paq.tar prueba.txt prueba2.docx prueba3.pdf
 //./star --delete -vf prueba-paq.tar prueba2.docx
 //./star -pvf prueba-paq.tar
+
+//---Limitar la memoria usada---
+//./star --max-memory=2M -xvf prueba-paq.tar
+
+//---Comparar y sincronizar el tar con el directorio---
+//./star --diff -vf prueba-paq.tar prueba.txt prueba2.docx prueba3.pdf
+//./star --sync -vf prueba-paq.tar prueba.txt prueba2.docx prueba3.pdf
+//Sin archivos se compara con todos los archivos del directorio actual
+//./star --diff -f prueba-paq.tar
+
+//---Lectores concurrentes con un escritor---
+//./star -cvf prueba-paq.tar prueba.txt prueba2.docx
+//./star -rvf prueba-paq.tar prueba3.pdf & ./star -xvf prueba-paq.tar
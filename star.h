@@ -0,0 +1,70 @@
+#ifndef STAR_H
+#define STAR_H
+
+// Formato del archivo tar y funciones de star-lib.c, compartidas entre star, star-mount y otros programas
+
+#define BLOCK_SIZE (256 * 1024) 
+#define MAX_FILES 100 
+#define MAX_FILENAME_LENGTH 256
+#define MAX_BLOCKS_PER_FILE 64 //Cambiar en caso de necesitar usar archivos mas grandes
+#define MAX_BLOCKS MAX_BLOCKS_PER_FILE * MAX_FILES
+
+// Bytes usados para bloqueos advisory (OFD), fuera del area de datos del tar
+#define LOCK_WRITER_OFFSET (1L << 62) // Un solo escritor a la vez
+#define LOCK_HEADER_OFFSET (LOCK_WRITER_OFFSET + 1) // Lectura/escritura de la FAT
+#define LOCK_READERS_OFFSET (LOCK_WRITER_OFFSET + 2) // Un byte por generacion leida
+
+#define DEFAULT_MAX_MEMORY (8L * 1024 * 1024) // Presupuesto de memoria si no se usa --max-memory
+
+#define STAR_MAGIC 0x54414652415453L // "STARFAT"
+#define STAR_VERSION 1 // Cambiar si cambia la estructura de FAT, FileEntry o LogRecord
+
+// Modo log (--log): los datos y un registro con las entradas nuevas se escriben al final del tar
+#define LOG_MAGIC 0x474f4c52415453L // "STARLOG"
+#define LOG_CHECKPOINT_RECORDS 32 // Registros acumulados antes de reescribir la FAT completa
+#define LOG_GROWTH_CHUNK (16L * 1024 * 1024) // Espacio que se reserva de una vez al final del tar
+
+#define HOLE_BLOCK 0 // Bloque hueco (solo ceros) que no ocupa espacio en el tar, la posicion 0 es de la FAT
+
+typedef struct {
+    char filename[MAX_FILENAME_LENGTH];
+    long file_size;
+    long block_positions[MAX_BLOCKS_PER_FILE];
+    long blocks_num; 
+} FileEntry;
+
+typedef struct {
+    long magic; // STAR_MAGIC, identifica un tar creado por star
+    long version; // STAR_VERSION, cambia cuando cambia el formato de la FAT
+    long generation; // Version de la FAT, aumenta en cada commit
+    long log_last; // Posicion del ultimo registro del log, 0 si no hay registros despues del checkpoint
+    long log_records_num;
+    FileEntry files[MAX_FILES];
+    long files_num;
+    long free_blocks[MAX_BLOCKS];
+    long free_blocks_num;
+    long pending_blocks[MAX_BLOCKS]; // Bloques liberados que un lector aun puede estar usando
+    long pending_generations[MAX_BLOCKS]; // Generacion a partir de la cual ya no se usan
+    long pending_blocks_num;
+} FAT;
+
+typedef struct {
+    unsigned char data[BLOCK_SIZE];
+} Block;
+
+typedef struct {
+    long magic;
+    long generation;
+    long prev; // Registro anterior, 0 si es el primero despues del checkpoint
+    long entries_num; // Seguido de entries_num FileEntry
+} LogRecord;
+
+// Funciones compartidas, definidas en star-lib.c
+long parse_memory_size(const char *text);
+int replay_log(int fd, FAT *fat);
+int lock_fd_range(int fd, short type, long start, long len);
+int load_fat_snapshot(int fd, FAT *fat);
+long contiguous_blocks(FileEntry *entry, long j, long max_blocks);
+long read_file_from_tar(const char *tar_filename, const char *filename, void *buffer, long buffer_size);
+
+#endif